@@ -6,361 +6,2113 @@
 */
 
 #include <algorithm>
+#include <bit>
 #include <bitset>
-#include <map>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define COMPRESSION_X86_64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define COMPRESSION_TARGET_AVX2
+#else
+#define COMPRESSION_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
 
 #include "compression.h"
 
-namespace compression
-{
-	/**
-	* \brief	Run-length encoding
-	*/
-	namespace rle
-	{
+namespace compression
+{
+	/**
+	* \brief		Count byte occurences of a raw range and add them to \p counts
+	* \details		Bytes are read 8 at a time and spread over four interleaved 32 bit
+	*				counter tables, so runs of the same byte do not serialize on the
+	*				store-to-load dependency of a single counter. The tables are folded
+	*				into \p counts per chunk, before any 32 bit counter could overflow.
+	* \param[in]	data	First byte of the range
+	* \param[in]	size	Number of bytes in the range
+	* \param[out]	counts	Histogram the occurences are added to
+	*/
+	void countBytes(const uint8_t *data, size_t size, histogram_t &counts)
+	{
+		static const size_t maxChunkSize = size_t(1) << 30;
+		uint32_t tables[4][256];
+
+		while (size > 0)
+		{
+			const size_t chunkSize = std::min(size, maxChunkSize);
+			const uint8_t *itData = data;
+			const uint8_t *itEnd = data + chunkSize;
+			uint64_t word = 0;
+
+			std::memset(tables, 0, sizeof(tables));
+
+			for (; itEnd - itData >= 8; itData += 8)
+			{
+				std::memcpy(&word, itData, sizeof(word));
+				++tables[0][word & 0xFF];
+				++tables[1][(word >> 8) & 0xFF];
+				++tables[2][(word >> 16) & 0xFF];
+				++tables[3][(word >> 24) & 0xFF];
+				++tables[0][(word >> 32) & 0xFF];
+				++tables[1][(word >> 40) & 0xFF];
+				++tables[2][(word >> 48) & 0xFF];
+				++tables[3][word >> 56];
+			}
+			while (itData != itEnd)
+			{
+				++tables[0][*itData++];
+			}
+
+			for (size_t i = 0; i < counts.size(); ++i)
+			{
+				counts[i] += static_cast<uint64_t>(tables[0][i]) + tables[1][i] + tables[2][i] + tables[3][i];
+			}
+
+			data += chunkSize;
+			size -= chunkSize;
+		}
+	}
+
+	/**
+	* \param[in]	dataIn	Data to be counted
+	* \return		Occurences of every byte value in \p dataIn
+	*/
+	histogram_t histogram(const std::vector<char> &dataIn)
+	{
+		return histogram(std::as_bytes(std::span(dataIn)));
+	}
+
+	/**
+	* \param[in]	dataIn	Data to be counted
+	* \return		Occurences of every byte value in \p dataIn
+	*/
+	histogram_t histogram(std::span<const std::byte> dataIn)
+	{
+		histogram_t counts = {};
+		countBytes(reinterpret_cast<const uint8_t *>(dataIn.data()), dataIn.size(), counts);
+		return counts;
+	}
+
+	/**
+	* \brief	Writes bit strings MSB first into a presized buffer
+	* \details	Bits are gathered in a 64 bit container and stored as whole 32 bit
+	*			words, so the buffer is touched once per word instead of once per bit.
+	*			The buffer must hold all bits written, rounded up to whole bytes.
+	*/
+	struct bitWriter_t
+	{
+		uint64_t container = 0;
+		uint8_t containerBits = 0;
+		char *itOut = nullptr;
+
+		bitWriter_t(char *out) : itOut(out) {}
+
+		/**
+		* \brief		Append the \p count low bits of \p bits, at most 32
+		*/
+		void write(const uint32_t bits, const uint8_t count)
+		{
+			container = (container << count) | bits;
+			containerBits += count;
+
+			if (containerBits >= 32)
+			{
+				containerBits -= 32;
+				const uint32_t word = static_cast<uint32_t>(container >> containerBits);
+				itOut[0] = static_cast<char>(word >> 24);
+				itOut[1] = static_cast<char>(word >> 16);
+				itOut[2] = static_cast<char>(word >> 8);
+				itOut[3] = static_cast<char>(word);
+				itOut += 4;
+			}
+		}
+
+		/**
+		* \brief		Store the remaining bits, padding the last byte with zeros
+		* \return		Position behind the last byte written
+		*/
+		char *flush()
+		{
+			while (containerBits >= 8)
+			{
+				containerBits -= 8;
+				*itOut++ = static_cast<char>(container >> containerBits);
+			}
+			if (containerBits > 0)
+			{
+				*itOut++ = static_cast<char>(container << (8 - containerBits));
+				containerBits = 0;
+			}
+			return itOut;
+		}
+	};
+
+	/**
+	* \brief		Load 8 bytes big endian from an unaligned position
+	*/
+	uint64_t loadUint64(const char *in)
+	{
+		uint8_t bytes[8];
+		std::memcpy(bytes, in, sizeof(bytes));
+		return (static_cast<uint64_t>(bytes[0]) << 56) | (static_cast<uint64_t>(bytes[1]) << 48) | (static_cast<uint64_t>(bytes[2]) << 40) | (static_cast<uint64_t>(bytes[3]) << 32) |
+			(static_cast<uint64_t>(bytes[4]) << 24) | (static_cast<uint64_t>(bytes[5]) << 16) | (static_cast<uint64_t>(bytes[6]) << 8) | static_cast<uint64_t>(bytes[7]);
+	}
+
+	/**
+	* \brief		Number of bytes of \p value stored as varint
+	*/
+	uint8_t varintSize(uint64_t value)
+	{
+		uint8_t size = 1;
+		for (; value >= 0x80; value >>= 7, ++size);
+		return size;
+	}
+
+	/**
+	* \brief		Store a value as LEB128 varint
+	* \details		Seven bits per byte, least significant first, the top bit of every
+	*				byte but the last set. Values below 128 take a single byte.
+	* \param[in]	value	Value to be stored
+	* \param[out]	out		Buffer of at least varintSize(\p value) bytes
+	* \return		Position behind the varint
+	*/
+	char *storeVarint(uint64_t value, char *out)
+	{
+		for (; value >= 0x80; value >>= 7)
+		{
+			*out++ = static_cast<char>(value | 0x80);
+		}
+		*out++ = static_cast<char>(value);
+		return out;
+	}
+
+	/**
+	* \brief		Load a LEB128 varint
+	* \param[in,out]	itIn	Begin of the varint, moved behind it
+	* \param[in]	itEnd	End of the buffer
+	* \param[out]	value	Loaded value
+	* \return		Whether a varint of at most 64 bits ends before \p itEnd
+	*/
+	bool loadVarint(const char *&itIn, const char *itEnd, uint64_t &value)
+	{
+		value = 0;
+
+		for (uint8_t shift = 0; shift < 64 && itIn != itEnd; shift += 7)
+		{
+			const uint8_t byte = static_cast<uint8_t>(*itIn++);
+
+			if (shift == 63 && byte > 1)
+			{
+				return false;
+			}
+			value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			if (byte < 0x80)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	* \brief	Reads bit strings MSB first from a buffer
+	* \details	Bits are consumed from the top of a 64 bit container. While at least 8
+	*			bytes are left, a refill is a single unaligned 8 byte load topping the
+	*			container up to 56 to 63 bits, without further checks. Bits of a
+	*			partially loaded byte are loaded again by the next refill, which ORs
+	*			identical bits into place. The last 7 bytes are refilled bytewise,
+	*			followed by zero bytes, so the reader never touches memory outside of
+	*			[begin, end) and every refill provides at least 57 bits. Consuming
+	*			any of the zero bytes marks the reader as overrun.
+	*/
+	struct bitReader_t
+	{
+		/**
+		* \brief	Minimum number of valid bits after a refill
+		*/
+		static const uint8_t minRefillBits = 56;
+
+		uint64_t container = 0;
+		uint8_t containerBits = 0;
+		size_t paddingBytes = 0;
+		const char *itIn = nullptr;
+		const char *itEnd = nullptr;
+
+		bitReader_t() {}
+		bitReader_t(const char *begin, const char *end) : itIn(begin), itEnd(end) {}
+
+		/**
+		* \brief		Fill the container up to at least \p minRefillBits bits
+		*/
+		void refill()
+		{
+			if (itEnd - itIn >= 8)
+			{
+				container |= loadUint64(itIn) >> containerBits;
+				itIn += (63 - containerBits) >> 3;
+				containerBits |= minRefillBits;
+			}
+			else
+			{
+				for (; containerBits <= minRefillBits && itIn != itEnd; containerBits += 8)
+				{
+					container |= static_cast<uint64_t>(static_cast<uint8_t>(*itIn++)) << (minRefillBits - containerBits);
+				}
+				for (; containerBits <= minRefillBits; containerBits += 8)
+				{
+					++paddingBytes;
+				}
+			}
+		}
+
+		/**
+		* \brief		Whether more bits were consumed than the buffer holds
+		*/
+		bool overrun() const
+		{
+			return containerBits < 8 * paddingBytes;
+		}
+
+		/**
+		* \brief		Next \p count bits, between 1 and 32, without consuming them
+		*/
+		uint32_t peek(const uint8_t count) const
+		{
+			return static_cast<uint32_t>(container >> (64 - count));
+		}
+
+		/**
+		* \brief		Drop the next \p count bits
+		*/
+		void consume(const uint8_t count)
+		{
+			container <<= count;
+			containerBits -= count;
+		}
+	};
+
+	/**
+	* \brief	Run-length encoding
+	*/
+	namespace rle
+	{
+		/**
+		* \brief	Shortest run of equal elements stored as repeat, shorter ones are part of literals
+		*/
+		static const uint8_t minRunLength = 3;
+
+		/**
+		* \brief	Longest literal in elements a single control byte covers
+		*/
+		static const uint8_t maxLiteralLength = 128;
+
+		/**
+		* \brief	Control bit marking a repeat, its low bits hold the run length beyond \p minRunLength
+		*/
+		static const uint8_t repeatFlag = 0x80;
+
+		/**
+		* \brief	Low bits of a repeat control byte followed by a varint extending the run length
+		*/
+		static const uint8_t runLengthEscape = 0x7F;
+
+		/**
+		* \brief	Function finding the length of the run of equal elements starting at its first argument
+		*/
+		template <typename T>
+		using runScanner_t = size_t (*)(const T *itElements, const T *itEnd);
+
+		/**
+		* \brief		Length of the run starting at \p itElements, compared elementwise
+		* \param[in]	itElements	First element of the run
+		* \param[in]	itEnd		End of the data
+		* \return		Number of successive elements equal to the first, at least 1
+		*/
+		template <typename T>
+		size_t runLengthScalar(const T *itElements, const T *itEnd)
+		{
+			const T *itRun = itElements + 1;
+			for (; itRun != itEnd && *itRun == *itElements; ++itRun);
+			return itRun - itElements;
+		}
+
+#ifdef COMPRESSION_X86_64
+		/**
+		* \brief		Repeat an element over all bytes of a 16 byte vector
+		*/
+		template <typename T>
+		__m128i broadcast128(const T value)
+		{
+			if constexpr (sizeof(T) == 1)
+			{
+				return _mm_set1_epi8(static_cast<char>(value));
+			}
+			else if constexpr (sizeof(T) == 2)
+			{
+				return _mm_set1_epi16(static_cast<short>(value));
+			}
+			else if constexpr (sizeof(T) == 4)
+			{
+				return _mm_set1_epi32(static_cast<int>(value));
+			}
+			else
+			{
+				return _mm_set1_epi64x(static_cast<long long>(value));
+			}
+		}
+
+		/**
+		* \brief		Repeat an element over all bytes of a 32 byte vector
+		*/
+		template <typename T>
+		COMPRESSION_TARGET_AVX2 __m256i broadcast256(const T value)
+		{
+			if constexpr (sizeof(T) == 1)
+			{
+				return _mm256_set1_epi8(static_cast<char>(value));
+			}
+			else if constexpr (sizeof(T) == 2)
+			{
+				return _mm256_set1_epi16(static_cast<short>(value));
+			}
+			else if constexpr (sizeof(T) == 4)
+			{
+				return _mm256_set1_epi32(static_cast<int>(value));
+			}
+			else
+			{
+				return _mm256_set1_epi64x(static_cast<long long>(value));
+			}
+		}
+
+		/**
+		* \brief		Length of the run starting at \p itElements, compared 16 bytes at a time
+		* \details		Every block is compared bytewise against the broadcast first element.
+		*				The lowest clear bit of the comparison mask is the first differing
+		*				byte, its index divided by the element size the number of equal
+		*				elements within the block.
+		*/
+		template <typename T>
+		size_t runLengthSse2(const T *itElements, const T *itEnd)
+		{
+			static const size_t blockLength = 16 / sizeof(T);
+			const __m128i pattern = broadcast128(*itElements);
+			const T *itRun = itElements;
+
+			for (; static_cast<size_t>(itEnd - itRun) >= blockLength; itRun += blockLength)
+			{
+				const uint32_t equal = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(itRun)), pattern)));
+				if (equal != 0xFFFF)
+				{
+					return itRun - itElements + std::countr_one(equal) / sizeof(T);
+				}
+			}
+			for (; itRun != itEnd && *itRun == *itElements; ++itRun);
+
+			return itRun - itElements;
+		}
+
+		/**
+		* \brief		Length of the run starting at \p itElements, compared 32 bytes at a time
+		*/
+		template <typename T>
+		COMPRESSION_TARGET_AVX2 size_t runLengthAvx2(const T *itElements, const T *itEnd)
+		{
+			static const size_t blockLength = 32 / sizeof(T);
+			const __m256i pattern = broadcast256(*itElements);
+			const T *itRun = itElements;
+
+			for (; static_cast<size_t>(itEnd - itRun) >= blockLength; itRun += blockLength)
+			{
+				const uint32_t equal = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(itRun)), pattern)));
+				if (equal != 0xFFFFFFFF)
+				{
+					return itRun - itElements + std::countr_one(equal) / sizeof(T);
+				}
+			}
+
+			return itRun - itElements + (itRun != itEnd && *itRun == *itElements ? runLengthSse2(itRun, itEnd) : 0);
+		}
+
+		/**
+		* \brief		Whether the CPU and operating system support AVX2
+		*/
+		bool supportsAvx2()
+		{
+#ifdef _MSC_VER
+			int info[4] = {};
+
+			__cpuid(info, 0);
+			if (info[0] < 7)
+			{
+				return false;
+			}
+
+			// AVX and OSXSAVE, and the OS saving YMM registers
+			__cpuid(info, 1);
+			if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+			{
+				return false;
+			}
+
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+#else
+			return __builtin_cpu_supports("avx2");
+#endif
+		}
+#endif
+
+		/**
+		* \brief		Pick the fastest run scanner the CPU supports
+		*/
+		template <typename T>
+		runScanner_t<T> selectRunScanner()
+		{
+#ifdef COMPRESSION_X86_64
+			return supportsAvx2() ? runLengthAvx2<T> : runLengthSse2<T>;
+#else
+			return runLengthScalar<T>;
+#endif
+		}
+
+		/**
+		* \brief		Length of the run starting at \p itElements
+		* \details		Dispatches to the run scanner selected once for the CPU.
+		* \param[in]	itElements	First element of the run
+		* \param[in]	itEnd		End of the data
+		* \return		Number of successive elements equal to the first, at least 1
+		*/
+		template <typename T>
+		size_t runLength(const T *itElements, const T *itEnd)
+		{
+			static const runScanner_t<T> scanner = selectRunScanner<T>();
+			return scanner(itElements, itEnd);
+		}
+
+		/**
+		* \brief		Write literals covering a range of elements
+		* \param[in]	itElements	First element of the range
+		* \param[in]	itEnd		End of the range
+		* \param[out]	itOut		Output position
+		* \param[in]	itOutEnd	End of the output
+		* \return		Position behind the literals or nullptr if the output is too small
+		*/
+		template <typename T>
+		char *writeLiterals(const T *itElements, const T *itEnd, char *itOut, const char *itOutEnd)
+		{
+			while (itElements != itEnd)
+			{
+				const size_t literalLength = std::min<size_t>(maxLiteralLength, itEnd - itElements);
+
+				if (static_cast<size_t>(itOutEnd - itOut) < 1 + literalLength * sizeof(T))
+				{
+					return nullptr;
+				}
+				*itOut++ = static_cast<char>(literalLength - 1);
+				std::memcpy(itOut, itElements, literalLength * sizeof(T));
+				itOut += literalLength * sizeof(T);
+				itElements += literalLength;
+			}
+
+			return itOut;
+		}
+
+		/**
+		* \brief		Read the next control byte and the run length it announces
+		* \param[in,out]	itBytes	Position of the control byte, moved behind the control
+		*				byte and any varint extending the run length
+		* \param[in]	itEnd	End of the data
+		* \param[out]	repeat	Whether the control byte announces a repeat rather than a literal
+		* \param[out]	length	Number of elements the literal or repeat decodes to
+		* \return		Whether the control byte is complete and its literal or repeated
+		*				element lies before \p itEnd
+		*/
+		template <typename T>
+		bool readControl(const char *&itBytes, const char *itEnd, bool &repeat, uint64_t &length)
+		{
+			const uint8_t control = static_cast<uint8_t>(*itBytes++);
+
+			repeat = (control & repeatFlag) != 0;
+			if (!repeat)
+			{
+				length = control + 1u;
+				return static_cast<uint64_t>(itEnd - itBytes) >= length * sizeof(T);
+			}
+
+			length = minRunLength + (control & runLengthEscape);
+			if ((control & runLengthEscape) == runLengthEscape)
+			{
+				uint64_t extension = 0;
+				if (!loadVarint(itBytes, itEnd, extension) || extension > std::numeric_limits<uint64_t>::max() - length)
+				{
+					return false;
+				}
+				length += extension;
+			}
+			return static_cast<size_t>(itEnd - itBytes) >= sizeof(T);
+		}
+
+		/**
+		* \details		Iterates entire dataset identifying runs of equal elements. Every
+		*				run of at least \p minRunLength elements is encoded as repeat: a
+		*				control byte with \p repeatFlag set, holding the run length beyond
+		*				\p minRunLength in its low bits, followed by the element. Runs too
+		*				long for the low bits escape to a varint holding the remaining
+		*				length. Elements in between are encoded as literals: a control byte
+		*				below \p repeatFlag holding the literal length minus 1, followed by
+		*				up to \p maxLiteralLength elements copied as they are.
+		* \param[in]	dataIn	Data to be encoded
+		* \param[out]	dataOut	Buffer receiving the RL encoded data
+		* \return		Size of the RL encoded data
+		*/
+		template <typename T>
+		result_t encode(std::span<const T> dataIn, std::span<std::byte> dataOut)
+		{
+			const T *itElements = dataIn.data();
+			const T *itEnd = itElements + dataIn.size();
+			const T *itLiteral = itElements;
+			char *itOut = reinterpret_cast<char *>(dataOut.data());
+			char *itOutEnd = itOut + dataOut.size();
+			size_t runCount = 0;
+
+			for (; itElements != itEnd; itElements += runCount)
+			{
+				// Elements not starting a run of at least minRunLength are left to the literal
+				runCount = 1;
+				if (itEnd - itElements < minRunLength || itElements[1] != itElements[0] || itElements[2] != itElements[0])
+				{
+					continue;
+				}
+
+				// Determine, how often the current element occurs in succession
+				runCount = runLength(itElements, itEnd);
+
+				// Only runs too long for the control byte are followed by the varint extension
+				const bool escaped = runCount - minRunLength >= runLengthEscape;
+				const size_t repeatSize = 1 + (escaped ? varintSize(runCount - minRunLength - runLengthEscape) : 0) + sizeof(T);
+
+				itOut = writeLiterals(itLiteral, itElements, itOut, itOutEnd);
+				if (itOut == nullptr || static_cast<size_t>(itOutEnd - itOut) < repeatSize)
+				{
+					return { 0, errorCode_t::outputTooSmall };
+				}
+
+				if (!escaped)
+				{
+					*itOut++ = static_cast<char>(repeatFlag | (runCount - minRunLength));
+				}
+				else
+				{
+					*itOut++ = static_cast<char>(repeatFlag | runLengthEscape);
+					itOut = storeVarint(runCount - minRunLength - runLengthEscape, itOut);
+				}
+				std::memcpy(itOut, itElements, sizeof(T));
+				itOut += sizeof(T);
+				itLiteral = itElements + runCount;
+			}
+
+			// Empty data fits an empty buffer, which may have no storage at all
+			if (itLiteral != itEnd)
+			{
+				itOut = writeLiterals(itLiteral, itEnd, itOut, itOutEnd);
+				if (itOut == nullptr)
+				{
+					return { 0, errorCode_t::outputTooSmall };
+				}
+			}
+
+			return { static_cast<size_t>(itOut - reinterpret_cast<char *>(dataOut.data())), errorCode_t::none };
+		}
+
+		/**
+		* \param[in]	dataIn	Data to be encoded
+		* \return		RL encoded data
+		*/
+		template <typename T>
+		std::vector<char> encode(const std::vector<T> &dataIn)
+		{
+			std::vector<char> dataOut(maxEncodedSize<T>(dataIn.size()));
+			dataOut.resize(encode(std::span<const T>(dataIn), std::as_writable_bytes(std::span(dataOut))).size);
+			return dataOut;
+		}
+
+		/**
+		* \details		Repeats never take more bytes than the run they cover, while
+		*				literals add a control byte per \p maxLiteralLength elements. Every
+		*				repeat saves at least the control byte of the literal following it.
+		* \param[in]	elementCount	Number of elements to be encoded
+		* \return		Upper bound of the RL encoded size
+		*/
+		template <typename T>
+		size_t maxEncodedSize(const size_t elementCount)
+		{
+			return elementCount * sizeof(T) + elementCount / maxLiteralLength + 1;
+		}
+
+		/**
+		* \details		Sums the lengths of all literals and repeats, skipping their elements.
+		* \param[in]	dataIn	RL encoded data
+		* \return		Number of elements of \p dataIn once decoded
+		*/
+		template <typename T>
+		result_t decodedSize(std::span<const std::byte> dataIn)
+		{
+			const char *itBytes = reinterpret_cast<const char *>(dataIn.data());
+			const char *itEnd = itBytes + dataIn.size();
+			bool repeat = false;
+			uint64_t length = 0;
+			size_t size = 0;
+
+			while (itBytes != itEnd)
+			{
+				if (!readControl<T>(itBytes, itEnd, repeat, length) || length > std::numeric_limits<size_t>::max() - size)
+				{
+					return { 0, errorCode_t::invalidInput };
+				}
+				itBytes += repeat ? sizeof(T) : length * sizeof(T);
+				size += static_cast<size_t>(length);
+			}
+
+			return { size, errorCode_t::none };
+		}
+
+		/**
+		* \details		Iterates entire dataset extracting literals and repeats, copying
+		*				literals and filling repeats into the output
+		* \param[in]	dataIn	Data to be decoded
+		* \param[out]	dataOut	Buffer receiving the RL decoded elements
+		* \return		Number of RL decoded elements
+		*/
+		template <typename T>
+		result_t decode(std::span<const std::byte> dataIn, std::span<T> dataOut)
+		{
+			const char *itBytes = reinterpret_cast<const char *>(dataIn.data());
+			const char *itEnd = itBytes + dataIn.size();
+			T *itOut = dataOut.data();
+			T *itOutEnd = itOut + dataOut.size();
+			bool repeat = false;
+			uint64_t length = 0;
+
+			while (itBytes != itEnd)
+			{
+				if (!readControl<T>(itBytes, itEnd, repeat, length))
+				{
+					return { 0, errorCode_t::invalidInput };
+				}
+				if (static_cast<uint64_t>(itOutEnd - itOut) < length)
+				{
+					return { 0, errorCode_t::outputTooSmall };
+				}
+
+				if (repeat)
+				{
+					T element;
+					std::memcpy(&element, itBytes, sizeof(T));
+					itBytes += sizeof(T);
+					itOut = std::fill_n(itOut, length, element);
+				}
+				else
+				{
+					std::memcpy(itOut, itBytes, length * sizeof(T));
+					itBytes += length * sizeof(T);
+					itOut += length;
+				}
+			}
+
+			return { static_cast<size_t>(itOut - dataOut.data()), errorCode_t::none };
+		}
+
+		/**
+		* \details		Sizes the output from the summed lengths of all literals and
+		*				repeats first, then copies literals and fills repeats into it.
+		* \param[in]	dataIn	Data to be decoded
+		* \return		RL decoded elements
+		*/
+		template <typename T>
+		std::vector<T> decode(const std::vector<char> &dataIn)
+		{
+			const result_t size = decodedSize<T>(std::as_bytes(std::span(dataIn)));
+			std::vector<T> dataOut;
+
+			// Repeats may claim more than any vector holds, which is no valid input either
+			if (size.error != errorCode_t::none || size.size > dataOut.max_size())
+			{
+				throw std::invalid_argument("compression::rle::decode: invalid input");
+			}
+
+			dataOut.resize(size.size);
+
+			decode<T>(std::as_bytes(std::span(dataIn)), std::span<T>(dataOut));
+
+			return dataOut;
+		}
+
+#define COMPRESSION_RLE_INSTANTIATE(T) \
+		template std::vector<char> encode<T>(const std::vector<T> &dataIn); \
+		template result_t encode<T>(std::span<const T> dataIn, std::span<std::byte> dataOut); \
+		template size_t maxEncodedSize<T>(size_t elementCount); \
+		template result_t decodedSize<T>(std::span<const std::byte> dataIn); \
+		template std::vector<T> decode<T>(const std::vector<char> &dataIn); \
+		template result_t decode<T>(std::span<const std::byte> dataIn, std::span<T> dataOut);
+
+		COMPRESSION_RLE_INSTANTIATE(uint8_t)
+		COMPRESSION_RLE_INSTANTIATE(uint16_t)
+		COMPRESSION_RLE_INSTANTIATE(uint32_t)
+		COMPRESSION_RLE_INSTANTIATE(uint64_t)
+
+#undef COMPRESSION_RLE_INSTANTIATE
+
+		/**
+		* \param[in]	dataIn	Data to be encoded
+		* \return		RL encoded data
+		*/
+		std::vector<char> encode(const std::vector<char> &dataIn)
+		{
+			std::vector<char> dataOut(maxEncodedSize(dataIn.size()));
+			dataOut.resize(encode(std::as_bytes(std::span(dataIn)), std::as_writable_bytes(std::span(dataOut))).size);
+			return dataOut;
+		}
+
+		/**
+		* \details		Byte runs are encoded as runs of uint8_t elements.
+		* \param[in]	dataIn	Data to be encoded
+		* \param[out]	dataOut	Buffer receiving the RL encoded data
+		* \return		Size of the RL encoded data
+		*/
+		result_t encode(std::span<const std::byte> dataIn, std::span<std::byte> dataOut)
+		{
+			return encode(std::span<const uint8_t>(reinterpret_cast<const uint8_t *>(dataIn.data()), dataIn.size()), dataOut);
+		}
+
+		/**
+		* \param[in]	dataSize	Size of the data to be encoded
+		* \return		Upper bound of the RL encoded size
+		*/
+		size_t maxEncodedSize(const size_t dataSize)
+		{
+			return maxEncodedSize<uint8_t>(dataSize);
+		}
+
+		/**
+		* \param[in]	dataIn	RL encoded data
+		* \return		Size of \p dataIn once decoded
+		*/
+		result_t decodedSize(std::span<const std::byte> dataIn)
+		{
+			return decodedSize<uint8_t>(dataIn);
+		}
+
+		/**
+		* \param[in]	dataIn	Data to be decoded
+		* \return		RL decoded data
+		*/
+		std::vector<char> decode(const std::vector<char> &dataIn)
+		{
+			const result_t size = decodedSize(std::as_bytes(std::span(dataIn)));
+			std::vector<char> dataOut;
+
+			// Repeats may claim more than any vector holds, which is no valid input either
+			if (size.error != errorCode_t::none || size.size > dataOut.max_size())
+			{
+				throw std::invalid_argument("compression::rle::decode: invalid input");
+			}
+
+			dataOut.resize(size.size);
+
+			decode(std::as_bytes(std::span(dataIn)), std::as_writable_bytes(std::span(dataOut)));
+
+			return dataOut;
+		}
+
+		/**
+		* \param[in]	dataIn	Data to be decoded
+		* \param[out]	dataOut	Buffer receiving the RL decoded data
+		* \return		Size of the RL decoded data
+		*/
+		result_t decode(std::span<const std::byte> dataIn, std::span<std::byte> dataOut)
+		{
+			return decode(dataIn, std::span<uint8_t>(reinterpret_cast<uint8_t *>(dataOut.data()), dataOut.size()));
+		}
+	} // namespace rle
+
+	namespace huffman
+	{
+		/**
+		* \brief	Maximum number of nodes of a huffman tree over all byte values
+		*/
+		static const uint16_t maxNodeCount = 2 * 256 - 1;
+
+		/**
+		* \brief	Huffman code length of every byte value, 0 for bytes not being coded
+		*/
+		typedef std::array<uint8_t, 256> codeLengths_t;
+
+		/**
+		* \brief	Upper bound of any code length the format supports
+		*/
+		static const uint8_t maxCodeLengthLimit = 15;
+
+		/**
+		* \brief		Compute huffman code lengths from byte occurences
+		* \details		Two-queue construction: the leaves are sorted by occurences once,
+		*				merged nodes are created in non-decreasing weight order and thus form
+		*				a second sorted queue, so every merge only compares the queue fronts.
+		*				The tree is held in fixed arrays of weights and parent indices, code
+		*				lengths are the node depths resolved from the root downwards.
+		*				A single occuring byte is given a code length of 1.
+		*				Lengths exceeding \p maxLength are limited afterwards: the number of
+		*				codes per length is clamped, then codes are moved one level down until
+		*				the Kraft sum is exactly 1 again, and the resulting lengths are handed
+		*				out to the bytes in order of their occurences.
+		* \param[in]	occurences	Occurences of every byte value
+		* \param[in]	maxLength	Upper bound of code lengths, at least 8
+		* \return		Code length of every byte value
+		*/
+		codeLengths_t buildCodeLengths(const histogram_t &occurences, const uint8_t maxLength)
+		{
+			codeLengths_t lengths = {};
+			uint8_t leaves[256];
+			uint64_t weights[maxNodeCount];
+			uint16_t parents[maxNodeCount];
+			uint8_t depths[maxNodeCount];
+			uint16_t leafCount = 0;
+
+			for (uint16_t byte = 0; byte < occurences.size(); ++byte)
+			{
+				if (occurences[byte] > 0)
+				{
+					leaves[leafCount++] = static_cast<uint8_t>(byte);
+				}
+			}
+
+			if (leafCount <= 1)
+			{
+				if (leafCount == 1)
+				{
+					lengths[leaves[0]] = 1;
+				}
+				return lengths;
+			}
+
+			std::sort(leaves, leaves + leafCount, [&occurences](const uint8_t byte0, const uint8_t byte1) { return occurences[byte0] < occurences[byte1]; });
+
+			for (uint16_t i = 0; i < leafCount; ++i)
+			{
+				weights[i] = occurences[leaves[i]];
+			}
+
+			uint16_t itLeaves = 0;
+			uint16_t itMerged = leafCount;
+			uint16_t nodeCount = leafCount;
+			auto popMinimum = [&]() -> uint16_t
+			{
+				if (itLeaves < leafCount && (itMerged == nodeCount || weights[itLeaves] <= weights[itMerged]))
+				{
+					return itLeaves++;
+				}
+				return itMerged++;
+			};
+
+			while (nodeCount < 2 * leafCount - 1)
+			{
+				const uint16_t child0 = popMinimum();
+				const uint16_t child1 = popMinimum();
+				weights[nodeCount] = weights[child0] + weights[child1];
+				parents[child0] = nodeCount;
+				parents[child1] = nodeCount;
+				++nodeCount;
+			}
+
+			// Parents always have higher indices than their children, the root is last
+			depths[nodeCount - 1] = 0;
+			for (int16_t node = nodeCount - 2; node >= 0; --node)
+			{
+				depths[node] = depths[parents[node]] + 1;
+			}
+
+			uint16_t lengthCounts[256] = {};
+			uint32_t kraftSum = 0;
+			bool isLimited = false;
+
+			for (uint16_t i = 0; i < leafCount; ++i)
+			{
+				isLimited |= depths[i] > maxLength;
+				++lengthCounts[std::min(depths[i], maxLength)];
+			}
+
+			if (!isLimited)
+			{
+				for (uint16_t i = 0; i < leafCount; ++i)
+				{
+					lengths[leaves[i]] = depths[i];
+				}
+				return lengths;
+			}
+
+			for (uint8_t length = 1; length <= maxLength; ++length)
+			{
+				kraftSum += static_cast<uint32_t>(lengthCounts[length]) << (maxLength - length);
+			}
+
+			while (kraftSum > (uint32_t(1) << maxLength))
+			{
+				// Drop one code of maximum length, split the longest shorter code into two
+				--lengthCounts[maxLength];
+				for (uint8_t length = maxLength - 1; length > 0; --length)
+				{
+					if (lengthCounts[length] > 0)
+					{
+						--lengthCounts[length];
+						lengthCounts[length + 1] += 2;
+						break;
+					}
+				}
+				--kraftSum;
+			}
+
+			// Leaves are sorted by increasing occurences, hand out the longest lengths first
+			for (uint16_t i = 0, length = maxLength; i < leafCount; ++i)
+			{
+				while (lengthCounts[length] == 0)
+				{
+					--length;
+				}
+				--lengthCounts[length];
+				lengths[leaves[i]] = static_cast<uint8_t>(length);
+			}
+
+			return lengths;
+		}
+
+		/**
+		* \brief	Canonical huffman code of every byte value
+		* \details	Codes are right aligned in \p codes, their lengths in bits are in \p lengths.
+		*/
+		struct codeTable_t
+		{
+			std::array<uint16_t, 256> codes = {};
+			codeLengths_t lengths = {};
+		};
+
+		/**
+		* \brief		Check whether code lengths describe a complete prefix code
+		* \details		A Kraft sum above 1 would overflow code lengths and the decoding
+		*				tables, one below 1 would leave bit patterns undecodable. Data of a
+		*				single byte value is not huffman coded, so every valid code is
+		*				complete.
+		* \param[in]	lengths	Code length of every byte value, at most \p maxCodeLengthLimit
+		* \return		Whether the Kraft sum of \p lengths is exactly 1
+		*/
+		bool isPrefixCode(const codeLengths_t &lengths)
+		{
+			uint32_t kraftSum = 0;
+
+			for (uint8_t length : lengths)
+			{
+				if (length > 0)
+				{
+					kraftSum += uint32_t(1) << (maxCodeLengthLimit - length);
+				}
+			}
+
+			return kraftSum == (uint32_t(1) << maxCodeLengthLimit);
+		}
+
+		/**
+		* \brief		Assign canonical prefix codes to code lengths
+		* \details		Codes are handed out in order of increasing length and byte value:
+		*				the first code of every length follows from the number of codes of
+		*				all shorter lengths. Encoder and decoder thereby derive identical
+		*				codes from the lengths alone.
+		* \param[in]	lengths	Code length of every byte value, at most \p maxCodeLengthLimit
+		* \return		Code table of all byte values
+		*/
+		codeTable_t assignCodes(const codeLengths_t &lengths)
+		{
+			codeTable_t table;
+			uint16_t lengthCounts[maxCodeLengthLimit + 1] = {};
+			uint16_t nextCodes[maxCodeLengthLimit + 1] = {};
+			uint16_t code = 0;
+
+			table.lengths = lengths;
+
+			for (uint8_t length : lengths)
+			{
+				++lengthCounts[length];
+			}
+			lengthCounts[0] = 0;
+
+			for (uint8_t length = 1; length <= maxCodeLengthLimit; ++length)
+			{
+				code = static_cast<uint16_t>((code + lengthCounts[length - 1]) << 1);
+				nextCodes[length] = code;
+			}
+
+			for (size_t byte = 0; byte < lengths.size(); ++byte)
+			{
+				if (lengths[byte] > 0)
+				{
+					table.codes[byte] = nextCodes[lengths[byte]]++;
+				}
+			}
+
+			return table;
+		}
+
+		/**
+		* \brief	Number of bits resolved by a single lookup into the primary decoding table
+		*/
+		static const uint8_t primaryBits = 11;
+
+		/**
+		* \brief	Number of bits following the primary bits resolved by a secondary decoding table
+		*/
+		static const uint8_t secondaryBits = maxCodeLengthLimit - primaryBits;
+
+		/**
+		* \brief	Flag marking a primary table entry as reference to a secondary table
+		*/
+		static const uint16_t secondaryFlag = 0x8000;
+
+		/**
+		* \brief	Lookup tables resolving the next code of a bitstream
+		* \details	The primary table is indexed by the next \p primaryBits bits and holds
+		*			the byte value in its low and the code length in its high byte. Codes
+		*			longer than \p primaryBits bits share their prefix entry, which instead
+		*			holds \p secondaryFlag and the offset of a secondary table indexed by
+		*			the following \p secondaryBits bits. Both fit into L1 cache.
+		*/
+		struct decodeTable_t
+		{
+			std::array<uint16_t, 1 << primaryBits> primary = {};
+			std::array<uint16_t, 256 << secondaryBits> secondary = {};
+		};
+
+		/**
+		* \brief		Build decoding lookup tables from a code table
+		* \param[in]	table	Code table of all byte values
+		* \return		Decoding tables resolving every code of \p table
+		*/
+		decodeTable_t buildDecodeTable(const codeTable_t &table)
+		{
+			decodeTable_t decodeTable;
+			uint16_t secondaryCount = 0;
+
+			for (uint16_t byte = 0; byte < table.lengths.size(); ++byte)
+			{
+				const uint8_t length = table.lengths[byte];
+				const uint16_t entry = static_cast<uint16_t>((length << 8) | byte);
+
+				if (length == 0)
+				{
+					continue;
+				}
+
+				if (length <= primaryBits)
+				{
+					const uint16_t first = static_cast<uint16_t>(table.codes[byte] << (primaryBits - length));
+					std::fill_n(decodeTable.primary.begin() + first, 1 << (primaryBits - length), entry);
+				}
+				else
+				{
+					uint16_t &prefixEntry = decodeTable.primary[table.codes[byte] >> (length - primaryBits)];
+					if ((prefixEntry & secondaryFlag) == 0)
+					{
+						prefixEntry = static_cast<uint16_t>(secondaryFlag | (secondaryCount++ << secondaryBits));
+					}
+
+					const uint16_t suffix = table.codes[byte] & ((1 << (length - primaryBits)) - 1);
+					const uint16_t first = static_cast<uint16_t>((prefixEntry & ~secondaryFlag) + (suffix << (maxCodeLengthLimit - length)));
+					std::fill_n(decodeTable.secondary.begin() + first, 1 << (maxCodeLengthLimit - length), entry);
+				}
+			}
+
+			return decodeTable;
+		}
+
+		/**
+		* \brief		Decode the next code of a bitstream
+		* \param[in]	decodeTable	Decoding tables of the code
+		* \param[in]	reader		Bitstream holding at least one complete code
+		* \return		Decoded byte
+		*/
+		char decodeByte(const decodeTable_t &decodeTable, bitReader_t &reader)
+		{
+			uint16_t entry = decodeTable.primary[reader.peek(primaryBits)];
+			if (entry & secondaryFlag)
+			{
+				entry = decodeTable.secondary[(entry & ~secondaryFlag) + (reader.peek(maxCodeLengthLimit) & ((1 << secondaryBits) - 1))];
+			}
+			reader.consume(static_cast<uint8_t>(entry >> 8));
+			return static_cast<char>(entry);
+		}
+
+		/**
+		* \brief	Minimum number of bytes per bitstream worth splitting data for
+		*/
+		static const size_t minStreamSize = 1024;
+
+		/**
+		* \brief	Number of bitstreams decoded in lockstep
+		*/
+		static const uint8_t lockstepWidth = 4;
+
+		/**
+		* \brief	Minimum number of decoded bytes worth starting a thread for
+		*/
+		static const size_t minRangeSize = 256 * 1024;
+
+		/**
+		* \brief		Number of bytes covered by every segment the data is split into
+		* \details		Segments are coded into separate bitstreams. They either cover the
+		*				requested block size or split the data into the requested number of
+		*				streams, each of at least \p minStreamSize bytes.
+		* \param[in]	dataSize	Size of the data to be encoded
+		* \param[in]	options		Encoder settings
+		* \return		Segment size, at least 1
+		*/
+		size_t segmentSize(const size_t dataSize, const options_t &options)
+		{
+			if (options.blockSize > 0)
+			{
+				return options.blockSize;
+			}
+
+			const size_t streamCount = std::max<size_t>(1, std::min<size_t>(options.streamCount, dataSize / minStreamSize));
+			return std::max<size_t>(1, (dataSize + streamCount - 1) / streamCount);
+		}
+
+		/**
+		* \brief	Segment layout of huffman encoded data
+		*/
+		struct segments_t
+		{
+			size_t dataSize = 0;
+			size_t segmentSize = 1;
+			size_t segmentCount = 0;
+
+			/**
+			* \brief	Bytes per jump table entry, enough for the encoded size of any segment
+			*/
+			uint8_t jumpWidth = 1;
+
+			segments_t() {}
+			segments_t(const size_t dataSize, const size_t segmentSize) : dataSize(dataSize), segmentSize(segmentSize), segmentCount(dataSize / segmentSize + (dataSize % segmentSize != 0))
+			{
+				const uint64_t encodedBound = segmentSize / 8 * maxCodeLengthLimit + (segmentSize % 8 * maxCodeLengthLimit + 7) / 8;
+				for (; jumpWidth < 8 && (encodedBound >> (8 * jumpWidth)) != 0; ++jumpWidth);
+			}
+
+			/**
+			* \brief		Offset of the first byte of \p segment, up to \p segmentCount for the end of the data
+			*/
+			size_t begin(const size_t segment) const
+			{
+				return std::min(dataSize, segment * segmentSize);
+			}
+
+			/**
+			* \brief		Number of bytes covered by \p segment
+			*/
+			size_t size(const size_t segment) const
+			{
+				return begin(segment + 1) - begin(segment);
+			}
+
+			/**
+			* \brief		Number of entries of the jump table, holding the encoded size of all segments but the last
+			*/
+			size_t jumpTableSize() const
+			{
+				return segmentCount > 0 ? segmentCount - 1 : 0;
+			}
+		};
+
+		/**
+		* \brief		Store the low \p width bytes of a value big endian
+		*/
+		char *storeUint(const uint64_t value, const uint8_t width, char *out)
+		{
+			for (uint8_t byte = width; byte > 0; --byte)
+			{
+				*out++ = static_cast<char>(value >> (8 * (byte - 1)));
+			}
+			return out;
+		}
+
+		/**
+		* \brief		Load a big endian value of \p width bytes
+		*/
+		uint64_t loadUint(const char *in, const uint8_t width)
+		{
+			uint64_t value = 0;
+			for (uint8_t byte = 0; byte < width; ++byte)
+			{
+				value = (value << 8) | static_cast<uint8_t>(in[byte]);
+			}
+			return value;
+		}
+
+		namespace header
+		{
+			/**
+			* \brief		Find the end of a run of unused byte values
+			* \param[in]	lengths Code length of every byte value
+			* \param[in]	byte First byte value of the run
+			* \return		First byte value behind the run, a run covers at most 256 values
+			*/
+			uint16_t zeroRunEnd(const codeLengths_t &lengths, const uint16_t byte)
+			{
+				uint16_t runEnd = byte + 1;
+				for (; runEnd < lengths.size() && runEnd - byte < 256 && lengths[runEnd] == 0; ++runEnd);
+				return runEnd;
+			}
+
+			/**
+			* \brief		Size of the serialized header of \p lengths
+			* \param[in]	lengths Code length of every byte value
+			* \return		Header size in bytes
+			*/
+			uint16_t size(const codeLengths_t &lengths)
+			{
+				uint16_t headerSize = 0;
+
+				for (uint16_t byte = 0; byte < lengths.size();)
+				{
+					if (lengths[byte] == 0)
+					{
+						byte = zeroRunEnd(lengths, byte);
+						headerSize += 2;
+					}
+					else
+					{
+						++byte;
+						++headerSize;
+					}
+				}
+
+				return headerSize;
+			}
+
+			/**
+			* \brief		Serialize huffman code lengths into a format which can be written into a file header
+			* \details		Codes are canonical, so the lengths of all 256 byte values in ascending
+			*				byte order fully describe them. Every length is stored in one byte, a
+			*				length of 0 is followed by the count of further bytes of length 0,
+			*				collapsing runs of unused byte values into two bytes each. The
+			*				header ends once all byte values are covered.
+			* \param[in]	lengths Code length of every byte value
+			* \param[out]	out Buffer of at least size(\p lengths) bytes
+			* \return		Position behind the header
+			*/
+			char *serialize(const codeLengths_t &lengths, char *out)
+			{
+				uint16_t runEnd = 0;
+
+				for (uint16_t byte = 0; byte < lengths.size();)
+				{
+					*out++ = static_cast<char>(lengths[byte]);
+
+					if (lengths[byte] == 0)
+					{
+						runEnd = zeroRunEnd(lengths, byte);
+						*out++ = static_cast<char>(runEnd - byte - 1);
+						byte = runEnd;
+					}
+					else
+					{
+						++byte;
+					}
+				}
+
+				return out;
+			}
+
+			/**
+			* \brief		Deserialize header to huffman code lengths
+			* \param[in,out]	itHeader Begin of the header, moved behind it
+			* \param[in]	itEnd End of the buffer
+			* \param[out]	lengths Code length of every byte value
+			* \return		Whether the header covers exactly all byte values with lengths of
+			*				at most \p maxCodeLengthLimit before \p itEnd
+			*/
+			bool deserialize(const char *&itHeader, const char *itEnd, codeLengths_t &lengths)
+			{
+				uint16_t byte = 0;
+
+				lengths = {};
+
+				while (byte < lengths.size() && itHeader != itEnd)
+				{
+					lengths[byte] = static_cast<uint8_t>(*itHeader++);
+
+					if (lengths[byte] > maxCodeLengthLimit)
+					{
+						return false;
+					}
+					else if (lengths[byte] == 0)
+					{
+						if (itHeader == itEnd || byte + 1u + static_cast<uint8_t>(*itHeader) > lengths.size())
+						{
+							return false;
+						}
+						byte += 1 + static_cast<uint8_t>(*itHeader++);
+					}
+					else
+					{
+						++byte;
+					}
+				}
+
+				return byte == lengths.size();
+			}
+		}
+
 		/**
-		* \details		Iterates entire dataset identifying byte runs and encoding them 
-		*				as pairs of { size_of_byterun, byte } into the output data.
-		* \param[in]	dataIn	Data to be encoded
-		* \return		RL encoded data
+		* \brief	How the data following the block header is stored
 		*/
-		std::vector<char> encode(const std::vector<char> &dataIn)
+		enum class blockMode_t : uint8_t
 		{
-			std::vector<char> dataOut = {};
-			uint64_t byteRunCount = 0;
-			char startByte = 0;
+			empty,		///< Nothing
+			single,		///< The one byte value the data consists of
+			stored,		///< The raw data
+			huffman		///< Code lengths, segment layout and bitstreams
+		};
 
-			for (std::vector<char>::const_iterator itBytes = dataIn.begin(); itBytes != dataIn.end(); ++itBytes, byteRunCount = 0)
-			{
-				// Determine, how often the current byte occurs in succession
-				startByte = *itBytes;
-				do
-				{
-					++byteRunCount;
-				} while (itBytes + byteRunCount != dataIn.end() && *(itBytes + byteRunCount) == startByte);
+		/**
+		* \brief	First byte of huffman encoded data
+		*/
+		static const uint8_t magic = 'H';
+
+		/**
+		* \brief	Version of the encoded format, stored next to the block mode
+		*/
+		static const uint8_t formatVersion = 1;
+
+		/**
+		* \brief		Size of the block header preceding the block
+		* \details		Magic, format version and block mode, and the original data size
+		*				as varint. Data below 2 MiB takes at most 5 bytes.
+		*/
+		size_t blockHeaderSize(const uint64_t dataSize)
+		{
+			return 2 + varintSize(dataSize);
+		}
+
+		/**
+		* \brief	Block header of huffman encoded data
+		*/
+		struct block_t
+		{
+			blockMode_t mode = blockMode_t::empty;
+			uint64_t dataSize = 0;
 
-				dataOut.push_back(byteRunCount);
-				dataOut.push_back(startByte);
+			/**
+			* \brief	Begin of the block behind its header
+			*/
+			const char *payload = nullptr;
+		};
 
-				itBytes += byteRunCount - 1;
+		/**
+		* \brief		Read and check the block header
+		* \param[in]	in		Begin of the huffman encoded data
+		* \param[in]	inEnd	End of the huffman encoded data
+		* \param[out]	block	Block header
+		* \return		Whether the block header is complete and of this format version
+		*/
+		bool readBlock(const char *in, const char *inEnd, block_t &block)
+		{
+			if (inEnd - in < 2 || static_cast<uint8_t>(in[0]) != magic || (static_cast<uint8_t>(in[1]) >> 4) != formatVersion)
+			{
+				return false;
 			}
 
-			return dataOut;
+			block.mode = static_cast<blockMode_t>(in[1] & 0x0F);
+			block.payload = in + 2;
+
+			return block.mode <= blockMode_t::huffman && loadVarint(block.payload, inEnd, block.dataSize) && block.dataSize <= std::numeric_limits<size_t>::max();
 		}
 
 		/**
-		* \details		Iterates entire dataset extracting {size_of_byterun, byte }
-		*				and writes the byterun to output
-		* \param[in]	dataIn	Data to be decoded
-		* \return		RL decoded data
+		* \brief	Everything needed to write huffman encoded data, derived from the data to be encoded
 		*/
-		std::vector<char> decode(const std::vector<char> &dataIn)
+		struct encoding_t
+		{
+			blockMode_t mode = blockMode_t::empty;
+			codeLengths_t lengths = {};
+			codeTable_t table;
+			segments_t segments;
+
+			/**
+			* \brief	Size of everything preceding the bitstreams
+			*/
+			size_t headerSize = 0;
+
+			/**
+			* \brief	Upper bound of the bitstreams' size
+			* \details	Every bitstream is padded to whole bytes, so the bound exceeds
+			*			their exact size by less than one byte per bitstream.
+			*/
+			uint64_t payloadBound = 0;
+		};
+
+		/**
+		* \brief		Derive block mode, code and layout of the huffman encoded data
+		* \details		Empty data and data of a single byte value get their own modes,
+		*				data huffman coding would not shrink is stored raw. Otherwise the
+		*				code lengths are followed by the segment size as varint and a jump
+		*				table holding the encoded size of all segments but the last.
+		* \param[in]	data		Data to be encoded
+		* \param[in]	dataSize	Size of \p data
+		* \param[in]	options		Encoder settings
+		* \return		Encoding of \p data
+		*/
+		encoding_t analyze(const char *data, const size_t dataSize, const options_t &options)
 		{
-			std::vector<char> dataOut = {};
-			uint64_t byteRunCount = 0;
-			char byte = 0;
+			if (options.maxCodeLength < 8 || options.maxCodeLength > maxCodeLengthLimit)
+			{
+				throw std::invalid_argument("compression::huffman::encode: maxCodeLength must be between 8 and 15");
+			}
+			if (options.streamCount == 0)
+			{
+				throw std::invalid_argument("compression::huffman::encode: streamCount must be at least 1");
+			}
 
-			for (std::vector<char>::const_iterator itBytes = dataIn.begin(); itBytes != dataIn.end(); itBytes += 2, byteRunCount = 0)
+			encoding_t encoding;
+			histogram_t occurences = {};
+			uint64_t payloadBits = 0;
+
+			countBytes(reinterpret_cast<const uint8_t *>(data), dataSize, occurences);
+			encoding.segments = segments_t(dataSize, segmentSize(dataSize, options));
+
+			if (std::count(occurences.begin(), occurences.end(), 0) >= static_cast<ptrdiff_t>(occurences.size()) - 1)
 			{
-				byteRunCount = *itBytes;
-				byte = *(itBytes + 1);
+				encoding.mode = dataSize > 0 ? blockMode_t::single : blockMode_t::empty;
+				encoding.headerSize = blockHeaderSize(dataSize) + (dataSize > 0 ? 1 : 0);
+				return encoding;
+			}
 
-				for (uint64_t i = 0; i < byteRunCount; ++i)
-				{
-					dataOut.push_back(byte);
-				}
+			encoding.lengths = buildCodeLengths(occurences, options.maxCodeLength);
+			encoding.table = assignCodes(encoding.lengths);
+
+			for (size_t byte = 0; byte < occurences.size(); ++byte)
+			{
+				payloadBits += occurences[byte] * encoding.lengths[byte];
 			}
 
-			return dataOut;
+			encoding.mode = blockMode_t::huffman;
+			encoding.headerSize = blockHeaderSize(dataSize) + header::size(encoding.lengths) + varintSize(encoding.segments.segmentSize) + encoding.segments.jumpWidth * encoding.segments.jumpTableSize();
+			encoding.payloadBound = (payloadBits + 7) / 8 + encoding.segments.jumpTableSize();
+
+			if (encoding.headerSize + encoding.payloadBound >= blockHeaderSize(dataSize) + dataSize)
+			{
+				encoding.mode = blockMode_t::stored;
+				encoding.headerSize = blockHeaderSize(dataSize);
+				encoding.payloadBound = dataSize;
+			}
+
+			return encoding;
 		}
-	} // namespace rle
 
-	namespace huffman
-	{
-		struct node_t
+		/**
+		* \brief		Exact encoded size of a segment, summed from its code lengths
+		* \details		Segments huffman coding would not shrink are stored raw. Huffman
+		*				coded segments are always smaller than the data they cover, so an
+		*				encoded size equal to the segment size marks a stored segment.
+		* \param[in]	encoding	Encoding of \p data
+		* \param[in]	data		Data to be encoded
+		* \param[in]	segment		Index of the segment
+		* \return		Size of the bitstream or raw bytes of \p segment
+		*/
+		uint64_t segmentPayloadSize(const encoding_t &encoding, const char *data, const size_t segment)
 		{
-			static std::vector<bool> tempBitset;
-
-			char byte = 0;
-			uint64_t occurences = 0;
-			std::pair<node_t *, node_t *> children = { nullptr, nullptr };
+			const uint8_t *itBytes = reinterpret_cast<const uint8_t *>(data) + encoding.segments.begin(segment);
+			const uint8_t *itEnd = itBytes + encoding.segments.size(segment);
+			uint64_t segmentBits = 0;
 
-			node_t() {}
-			node_t(const char byte, const uint64_t &occurences)
+			for (; itBytes != itEnd; ++itBytes)
 			{
-				this->byte = byte;
-				this->occurences = occurences;
+				segmentBits += encoding.lengths[*itBytes];
 			}
-			node_t(node_t *child0, node_t *child1)
+
+			return std::min<uint64_t>((segmentBits + 7) / 8, encoding.segments.size(segment));
+		}
+
+		/**
+		* \brief		Exact size of all segments of the huffman encoded data
+		* \details		A single segment is covered by the histogram of the whole data, so
+		*				its size is the bound. Otherwise every segment is counted.
+		* \param[in]	encoding	Encoding of \p data
+		* \param[in]	data		Data to be encoded
+		* \return		Size of the segments
+		*/
+		uint64_t payloadSize(const encoding_t &encoding, const char *data)
+		{
+			uint64_t size = 0;
+
+			if (encoding.mode != blockMode_t::huffman || encoding.segments.segmentCount == 1)
 			{
-				children.first = child0;
-				children.second = child1;
+				return encoding.payloadBound;
 			}
-			node_t(node_t *child0, node_t *child1, const uint64_t &occurences) : node_t(child0, child1)
+
+			for (size_t segment = 0; segment < encoding.segments.segmentCount; ++segment)
 			{
-				this->occurences = occurences;
+				size += segmentPayloadSize(encoding, data, segment);
 			}
 
-			void freeRecursively()
+			return size;
+		}
+
+		/**
+		* \brief	Number of bytes coded between checks of the bitstream size
+		*/
+		static const size_t writeChunkSize = 16;
+
+		/**
+		* \brief		Huffman code a segment unless that would not shrink it
+		* \details		Coding stops as soon as the bitstream would reach the segment size,
+		*				so nothing is written beyond one byte less than the segment. The
+		*				size is checked once per \p writeChunkSize bytes while even codes of
+		*				\p maxCodeLengthLimit bits fit, and once per byte near the limit.
+		* \param[in]	table	Code of every byte value
+		* \param[in]	itBegin	Begin of the segment
+		* \param[in]	itEnd	End of the segment
+		* \param[out]	out		Buffer large enough for the segment
+		* \return		End of the bitstream or nullptr if the segment is to be stored raw
+		*/
+		char *writeSegment(const codeTable_t &table, const char *itBegin, const char *itEnd, char *out)
+		{
+			const uint64_t bitLimit = 8 * static_cast<uint64_t>(itEnd - itBegin - 1);
+			bitWriter_t writer(out);
+			const char *itBytes = itBegin;
+
+			auto bitsWritten = [&]() -> uint64_t
+			{
+				return 8 * static_cast<uint64_t>(writer.itOut - out) + writer.containerBits;
+			};
+
+			while (static_cast<size_t>(itEnd - itBytes) >= writeChunkSize && bitsWritten() + writeChunkSize * maxCodeLengthLimit <= bitLimit)
 			{
-				if (children.first != nullptr)
+				for (const char *itChunkEnd = itBytes + writeChunkSize; itBytes != itChunkEnd; ++itBytes)
 				{
-					children.first->freeRecursively();
-					children.first = nullptr;
+					writer.write(table.codes[static_cast<uint8_t>(*itBytes)], table.lengths[static_cast<uint8_t>(*itBytes)]);
 				}
-				if (children.second != nullptr)
+			}
+			for (; itBytes != itEnd; ++itBytes)
+			{
+				if (bitsWritten() + table.lengths[static_cast<uint8_t>(*itBytes)] > bitLimit)
 				{
-					 
-					children.second->freeRecursively();
-					children.second = nullptr;
+					return nullptr;
 				}
-				delete this;
+				writer.write(table.codes[static_cast<uint8_t>(*itBytes)], table.lengths[static_cast<uint8_t>(*itBytes)]);
+			}
+
+			return writer.flush();
+		}
+
+		/**
+		* \brief		Write huffman encoded data
+		* \param[in]	encoding	Encoding of \p data
+		* \param[in]	data		Data to be encoded
+		* \param[out]	out			Buffer large enough for the encoded data
+		* \return		Size of the encoded data
+		*/
+		size_t write(const encoding_t &encoding, const char *data, char *out)
+		{
+			const segments_t &segments = encoding.segments;
+			char *itOut = out;
+
+			*itOut++ = static_cast<char>(magic);
+			*itOut++ = static_cast<char>((formatVersion << 4) | static_cast<uint8_t>(encoding.mode));
+			itOut = storeVarint(segments.dataSize, itOut);
+
+			switch (encoding.mode)
+			{
+			case blockMode_t::empty:
+				return itOut - out;
+			case blockMode_t::single:
+				*itOut++ = data[0];
+				return itOut - out;
+			case blockMode_t::stored:
+				std::memcpy(itOut, data, segments.dataSize);
+				return itOut + segments.dataSize - out;
+			case blockMode_t::huffman:
+				break;
 			}
 
-			void getCode(std::map<char, std::vector<bool>> &nodes)
+			itOut = header::serialize(encoding.lengths, itOut);
+			itOut = storeVarint(segments.segmentSize, itOut);
+
+			// Segment sizes are filled into the jump table as the segments are written
+			char *itJumpTable = itOut;
+			itOut += segments.jumpWidth * segments.jumpTableSize();
+
+			for (size_t segment = 0; segment < segments.segmentCount; ++segment)
 			{
-				if (children.first != nullptr && children.second != nullptr)
+				const char *itBegin = data + segments.begin(segment);
+				const char *itEnd = data + segments.begin(segment + 1);
+				char *itSegmentEnd = writeSegment(encoding.table, itBegin, itEnd, itOut);
+
+				if (itSegmentEnd == nullptr)
 				{
-					tempBitset.push_back(false);
-					children.first->getCode(nodes);
-					tempBitset.erase(tempBitset.end() - 1);
-					tempBitset.push_back(true);
-					children.second->getCode(nodes);
-					tempBitset.erase(tempBitset.end() - 1);
+					std::memcpy(itOut, itBegin, segments.size(segment));
+					itSegmentEnd = itOut + segments.size(segment);
 				}
-				else
+
+				if (segment + 1 < segments.segmentCount)
 				{
-					nodes[byte] = tempBitset;
+					itJumpTable = storeUint(itSegmentEnd - itOut, segments.jumpWidth, itJumpTable);
 				}
+				itOut = itSegmentEnd;
 			}
-		};
 
-		std::vector<bool> node_t::tempBitset = {};
+			return itOut - out;
+		}
+
+		/**
+		* \brief		Huffman encode entire dataset
+		* \details		The output is allocated once, large enough for any stream padding,
+		*				and trimmed to the size written.
+		* \param[in]	dataIn	Data to be encoded
+		* \param[in]	options	Encoder settings
+		* \return		Huffman encoded data
+		*/
+		std::vector<char> encode(const std::vector<char> &dataIn, const options_t &options)
+		{
+			const encoding_t encoding = analyze(dataIn.data(), dataIn.size(), options);
+			std::vector<char> dataOut(encoding.headerSize + encoding.payloadBound);
+
+			dataOut.resize(write(encoding, dataIn.data(), dataOut.data()));
 
-		namespace header
+			return dataOut;
+		}
+
+		/**
+		* \brief		Huffman encode entire dataset into a caller provided buffer
+		* \param[in]	dataIn	Data to be encoded
+		* \param[out]	dataOut	Buffer receiving the huffman encoded data
+		* \param[in]	options	Encoder settings
+		* \return		Size of the huffman encoded data
+		*/
+		result_t encode(std::span<const std::byte> dataIn, std::span<std::byte> dataOut, const options_t &options)
 		{
-			/*
-			* \brief		Serialize huffman code into a format which can be written into a file header
-			* \param[in]	code Mapping of byte to huffman code
-			* \return		Byte string representation of \p code
-			*/
-			std::vector<char> serialize(const std::map<char, std::vector<bool>> &code)
+			const char *data = reinterpret_cast<const char *>(dataIn.data());
+			const encoding_t encoding = analyze(data, dataIn.size(), options);
+
+			// Only a buffer smaller than the bound requires the exact size, counted per segment
+			if (encoding.headerSize + encoding.payloadBound > dataOut.size() && encoding.headerSize + payloadSize(encoding, data) > dataOut.size())
 			{
-				std::vector<char> header;
-				int16_t itBits = 0;
-				uint8_t itCodeBits = 0;
+				return { 0, errorCode_t::outputTooSmall };
+			}
 
-				for (std::pair<char, std::vector<bool>> pair : code)
-				{
-					header.push_back(pair.first);
-					header.push_back(pair.second.size());
-					header.push_back(0);
+			return { write(encoding, data, reinterpret_cast<char *>(dataOut.data())), errorCode_t::none };
+		}
 
-					for (itCodeBits = 0, itBits = 7; itCodeBits < pair.second.size();)
-					{
-						header[header.size() - 1] |= (pair.second[itCodeBits++] << itBits);
-						
-						if (--itBits < 0)
-						{
-							itBits = 7;
-							if (itCodeBits < pair.second.size())
-							{
-								header.push_back(0);
-							}
-						}
-					}
-				}
+		/**
+		* \details		Data huffman coding would not shrink is stored raw.
+		* \param[in]	dataSize	Size of the data to be encoded
+		* \param[in]	options		Encoder settings
+		* \return		Upper bound of the huffman encoded size
+		*/
+		size_t maxEncodedSize(const size_t dataSize, const options_t &)
+		{
+			return blockHeaderSize(dataSize) + dataSize;
+		}
 
-				header.insert(header.begin(), static_cast<char>(header.size() + 2));
-				header.insert(header.begin(), static_cast<char>((header.size() + 1) >> 8));
+		/**
+		* \param[in]	dataIn	Huffman encoded data, at least its block header
+		* \return		Size of \p dataIn once decoded
+		*/
+		result_t decodedSize(std::span<const std::byte> dataIn)
+		{
+			const char *in = reinterpret_cast<const char *>(dataIn.data());
+			block_t block;
 
-				return header;
+			if (!readBlock(in, in + dataIn.size(), block))
+			{
+				return { 0, errorCode_t::invalidInput };
 			}
+			return { static_cast<size_t>(block.dataSize), errorCode_t::none };
+		}
 
-			/**
-			* \brief		Deserialize header to huffman code
-			* \param[in]	header Header to be deserialized
-			* \return		Huffman code generated from header
-			*/
-			std::map<char, std::vector<bool>> deserialize(const std::vector<char> &header)
-			{
-				std::map<char, std::vector<bool>> code;
-				uint8_t byte = 0;
-				int16_t codeBitCount = 0;
-				int16_t itBits = 7;
-				std::vector<char>::const_iterator itHeader = header.begin();
-				do
-				{
-					byte = *itHeader++;
-					codeBitCount = *itHeader++;
-					itBits = 7;
-					while (--codeBitCount >= 0)
+		/**
+		* \brief		Encoded size of a segment
+		* \param[in]	segments	Segment layout
+		* \param[in]	jumpTable	Jump table of the segments
+		* \param[in]	payloadEnd	End of the last segment
+		* \param[in]	segment		Index of the segment
+		* \param[in]	itSegment	Begin of the segment
+		* \return		Size of the bitstream of \p segment
+		*/
+		size_t segmentEncodedSize(const segments_t &segments, const char *jumpTable, const char *payloadEnd, const size_t segment, const char *itSegment)
+		{
+			return segment + 1 < segments.segmentCount ? loadUint(jumpTable + segments.jumpWidth * segment, segments.jumpWidth) : payloadEnd - itSegment;
+		}
+
+		/**
+		* \brief		Decode a range of segments
+		* \details		Segments are decoded \p lockstepWidth at a time, advancing their
+		*				bitstreams in lockstep while each has bytes left. Stored segments
+		*				are copied and take no part in the lockstep.
+		* \param[in]	decodeTable	Decoding tables of the code
+		* \param[in]	segments	Segment layout
+		* \param[in]	jumpTable	Jump table of the segments
+		* \param[in]	payloadEnd	End of the last segment
+		* \param[in]	first		Index of the first segment to decode
+		* \param[in]	last		Index behind the last segment to decode
+		* \param[in]	itIn		Begin of segment \p first
+		* \param[out]	out			Output of the entire data
+		* \return		Whether no bitstream was overrun
+		*/
+		bool decodeSegments(const decodeTable_t &decodeTable, const segments_t &segments, const char *jumpTable, const char *payloadEnd, const size_t first, const size_t last, const char *itIn, char *out)
+		{
+			// Every refill provides enough bits for several codes
+			static const uint8_t codesPerRefill = bitReader_t::minRefillBits / maxCodeLengthLimit;
+
+			std::array<bitReader_t, lockstepWidth> readers;
+			std::array<char *, lockstepWidth> itStreamsOut;
+			std::array<char *, lockstepWidth> itStreamsOutEnd;
+			bool overrun = false;
+
+			for (size_t group = first; group < last; group += lockstepWidth)
+			{
+				const size_t groupEnd = std::min<size_t>(group + lockstepWidth, last);
+				uint8_t streamCount = 0;
+				size_t lockstepCount = 0;
+
+				for (size_t segment = group; segment < groupEnd; ++segment)
+				{
+					const size_t encodedSize = segmentEncodedSize(segments, jumpTable, payloadEnd, segment, itIn);
+
+					if (encodedSize == segments.size(segment))
+					{
+						std::memcpy(out + segments.begin(segment), itIn, encodedSize);
+					}
+					else
 					{
-						code[byte].push_back(((*itHeader) & (1 << itBits)) >> itBits);
+						readers[streamCount] = bitReader_t(itIn, itIn + encodedSize);
+						itStreamsOut[streamCount] = out + segments.begin(segment);
+						itStreamsOutEnd[streamCount] = out + segments.begin(segment + 1);
+						lockstepCount = streamCount > 0 ? std::min(lockstepCount, segments.size(segment)) : segments.size(segment);
+						++streamCount;
+					}
+					itIn += encodedSize;
+				}
 
-						if (--itBits < 0)
+				size_t itLockstep = 0;
+				for (; itLockstep + codesPerRefill <= lockstepCount; itLockstep += codesPerRefill)
+				{
+					for (uint8_t stream = 0; stream < streamCount; ++stream)
+					{
+						readers[stream].refill();
+						for (uint8_t i = 0; i < codesPerRefill; ++i)
 						{
-							itBits = 7;
-							if (codeBitCount > 0)
-							{
-								++itHeader;
-							}
+							*itStreamsOut[stream]++ = decodeByte(decodeTable, readers[stream]);
 						}
 					}
-					++itHeader;
-				} while (itHeader != header.end());
-
-				return code;
+				}
+				for (uint8_t stream = 0; stream < streamCount; ++stream)
+				{
+					while (itStreamsOut[stream] != itStreamsOutEnd[stream])
+					{
+						readers[stream].refill();
+						*itStreamsOut[stream]++ = decodeByte(decodeTable, readers[stream]);
+					}
+					overrun |= readers[stream].overrun();
+				}
 			}
+
+			return !overrun;
 		}
 
 		/**
-		* \brief		Huffman encode entire dataset
+		* \brief	Validated layout of a huffman coded block
 		*/
-		std::vector<char> encode(const std::vector<char> &dataIn)
+		struct huffmanLayout_t
 		{
-			std::vector<char> dataOut;
-			dataOut.push_back(0);
+			codeLengths_t lengths = {};
+			segments_t segments;
+			const char *jumpTable = nullptr;
 
-			std::map<char, uint64_t> byteOccurences = {};
-			std::vector<node_t *> treeNodes;
-			std::vector<bool> bits;
-			node_t node;
+			/**
+			* \brief	Begin of the first segment
+			*/
+			const char *itSegments = nullptr;
+			const char *payloadEnd = nullptr;
+		};
 
-			for (char byte : dataIn)
-			{
-				++byteOccurences[byte];
-			}
+		/**
+		* \brief		Validate a huffman coded block
+		* \details		The code lengths must form a complete prefix code and the jump table
+		*				must fit the payload. Every segment, the last one included, is either
+		*				stored, taking exactly its size, or takes at least the bits of all its
+		*				bytes coded with the shortest code. The size of the decoded data is
+		*				thus bounded by the size of the payload.
+		* \param[in]	in					Begin of the block behind its block header
+		* \param[in]	payloadEnd			End of the block
+		* \param[in]	originalDataSize	Size of the decoded data, at least 1
+		* \param[out]	layout				Layout of the block
+		* \return		Whether the block is valid
+		*/
+		bool parseHuffmanBlock(const char *in, const char *payloadEnd, const size_t originalDataSize, huffmanLayout_t &layout)
+		{
+			uint64_t segmentSize = 0;
+			const char *itIn = in;
 
-			for (std::pair<char, uint64_t> pair : byteOccurences)
+			if (!header::deserialize(itIn, payloadEnd, layout.lengths) || !isPrefixCode(layout.lengths))
 			{
-				treeNodes.push_back(new node_t(pair.first, pair.second));
+				return false;
 			}
-
-			while (treeNodes.size() > 1)
+			if (!loadVarint(itIn, payloadEnd, segmentSize) || segmentSize == 0 || segmentSize > std::numeric_limits<size_t>::max())
 			{
-				std::sort(treeNodes.begin(), treeNodes.end(), [](const node_t *node0, const node_t *node1) { return node0->occurences < node1->occurences; });
-
-				if (treeNodes.size() >= 2)
-				{
-					treeNodes.push_back(new node_t(treeNodes[0], treeNodes[1], treeNodes[0]->occurences + treeNodes[1]->occurences));
-					treeNodes.erase(treeNodes.begin(), treeNodes.begin() + 2);
-				}
+				return false;
 			}
 
-			std::map<char, std::vector<bool>> code;
-			treeNodes[0]->getCode(code);
+			const segments_t &segments = layout.segments = segments_t(originalDataSize, static_cast<size_t>(segmentSize));
+			size_t payloadSize = payloadEnd - itIn;
 
-			dataOut = header::serialize(code);
-			dataOut.insert(dataOut.begin(), static_cast<char>(dataIn.size()));
-			dataOut.insert(dataOut.begin(), static_cast<char>(dataIn.size() >> 8));
-			dataOut.insert(dataOut.begin(), static_cast<char>(dataIn.size() >> 16));
-			dataOut.insert(dataOut.begin(), static_cast<char>(dataIn.size() >> 24));
+			// Jump table must fit the payload
+			if (segments.jumpTableSize() > payloadSize / segments.jumpWidth)
+			{
+				return false;
+			}
+			payloadSize -= segments.jumpWidth * segments.jumpTableSize();
 
-			dataOut.push_back(0);
+			layout.jumpTable = itIn;
+			layout.itSegments = itIn + segments.jumpWidth * segments.jumpTableSize();
+			layout.payloadEnd = payloadEnd;
 
-			int8_t itBits = 7;
-			int64_t itCodeBits = 0;
-			for (char byte : dataIn)
+			uint8_t minLength = maxCodeLengthLimit;
+			for (uint8_t length : layout.lengths)
 			{
-				itCodeBits = 0;
-				while (itCodeBits < code[byte].size())
+				if (length > 0)
 				{
-					dataOut[dataOut.size() - 1] |= (code[byte][itCodeBits] << itBits);
-					++itCodeBits;
-					if (--itBits < 0)
-					{
-						itBits = 7;
-						dataOut.push_back(0);
-					}
+					minLength = std::min(minLength, length);
 				}
 			}
 
-			// cleanup
-			for (node_t *node : treeNodes)
+			for (size_t segment = 0; segment < segments.segmentCount; ++segment)
 			{
-				node->freeRecursively();
-				node = nullptr;
+				const uint64_t encodedSize = segment < segments.jumpTableSize() ? loadUint(layout.jumpTable + segments.jumpWidth * segment, segments.jumpWidth) : payloadSize;
+				const size_t size = segments.size(segment);
+				const uint64_t minEncodedSize = size / 8 * minLength + (size % 8 * minLength + 7) / 8;
+
+				if (encodedSize > payloadSize || (encodedSize != size && encodedSize < minEncodedSize))
+				{
+					return false;
+				}
+				payloadSize -= encodedSize;
 			}
 
-			return dataOut;
+			return true;
 		}
 
 		/**
-		* \brief		Huffman decode entire dataset
+		* \brief		Read and validate huffman encoded data without decoding it
+		* \details		Empty, single and stored blocks must end exactly at the end of
+		*				\p dataIn, huffman coded blocks assign the remaining bytes to their
+		*				last segment.
+		* \param[in]	dataIn	Huffman encoded data
+		* \param[out]	block	Block header
+		* \param[out]	layout	Layout of a huffman coded block
+		* \return		Size of \p dataIn once decoded or errorCode_t::invalidInput
 		*/
-		std::vector<char> decode(const std::vector<char> &dataIn)
+		result_t validate(std::span<const std::byte> dataIn, block_t &block, huffmanLayout_t &layout)
 		{
-			std::vector<char> dataOut;
+			const char *in = reinterpret_cast<const char *>(dataIn.data());
+			const char *inEnd = in + dataIn.size();
 
-			node_t *treeNode = new node_t(nullptr, nullptr);
-			node_t *node = treeNode;
+			if (!readBlock(in, inEnd, block))
+			{
+				return { 0, errorCode_t::invalidInput };
+			}
 
-			int16_t itBits = 7;
+			const size_t originalDataSize = static_cast<size_t>(block.dataSize);
+			const size_t payloadSize = inEnd - block.payload;
+			bool valid = false;
+
+			switch (block.mode)
+			{
+			case blockMode_t::empty:
+				valid = originalDataSize == 0 && payloadSize == 0;
+				break;
+			case blockMode_t::single:
+				valid = originalDataSize > 0 && payloadSize == 1;
+				break;
+			case blockMode_t::stored:
+				valid = payloadSize == originalDataSize;
+				break;
+			case blockMode_t::huffman:
+				valid = originalDataSize > 0 && parseHuffmanBlock(block.payload, inEnd, originalDataSize, layout);
+				break;
+			}
 
-			uint16_t headerSize = 0;
-			uint32_t originalDataSize = 0;
+			if (!valid)
+			{
+				return { 0, errorCode_t::invalidInput };
+			}
 
-			originalDataSize |= static_cast<uint32_t>(dataIn[3]) & 0x000000FF;
-			originalDataSize |= (static_cast<uint32_t>(dataIn[2]) << 8) & 0x0000FF00;
-			originalDataSize |= (static_cast<uint32_t>(dataIn[1]) << 16) & 0x00FF0000;
-			originalDataSize |= (static_cast<uint32_t>(dataIn[0]) << 24) & 0xFF000000;
+			return { originalDataSize, errorCode_t::none };
+		}
 
-			headerSize |= static_cast<uint16_t>(dataIn[5]) & 0x00FF;
-			headerSize |= (static_cast<uint16_t>(dataIn[4]) << 8) & 0xFF00;
+		/**
+		* \brief		Decode a validated huffman coded block
+		* \details		Segments are decoded without further checks, only overruns of their
+		*				bitstreams are detected afterwards. With more than one thread, the
+		*				segments are split into contiguous ranges decoded by separate
+		*				threads, the calling thread taking the last and any range no thread
+		*				could be started for. No more threads are used than hardware
+		*				threads, nor than ranges of at least \p minRangeSize bytes.
+		* \param[in]	layout		Layout of the block
+		* \param[out]	out			Buffer large enough for the decoded data
+		* \param[in]	threadCount	Number of threads decoding segments in parallel
+		* \return		Whether no bitstream was overrun
+		*/
+		bool decodeHuffmanBlock(const huffmanLayout_t &layout, char *out, const unsigned threadCount)
+		{
+			const segments_t &segments = layout.segments;
+			const decodeTable_t decodeTable = buildDecodeTable(assignCodes(layout.lengths));
+			const char *itSegments = layout.itSegments;
 
-			std::map<char, std::vector<bool>> code = header::deserialize({ dataIn.begin() + 6, dataIn.begin() + headerSize + 4 });
+			// Ranges are whole lockstep groups, as evenly spread over the threads as possible
+			const size_t groupCount = (segments.segmentCount + lockstepWidth - 1) / lockstepWidth;
+			const size_t minRangeGroups = std::max<size_t>(1, minRangeSize / lockstepWidth / segments.segmentSize);
+			const size_t hardwareThreads = std::thread::hardware_concurrency();
+			size_t usedThreads = std::min<size_t>(std::max(threadCount, 1u), std::max<size_t>(1, groupCount / minRangeGroups));
 
-			for (std::pair<char, std::vector<bool>> pair : code)
+			if (hardwareThreads > 0)
 			{
-				node = treeNode;
-				for (std::vector<bool>::iterator itBits = pair.second.begin(); itBits != pair.second.end(); ++itBits)
-				{
-					if ((*itBits ? node->children.second : node->children.first) == nullptr)
-					{
-						(*itBits ? node->children.second : node->children.first) = new node_t(itBits == pair.second.end() - 1 ? pair.first : 0, 0);
-					}
-					node = (*itBits ? node->children.second : node->children.first);
-				}
+				usedThreads = std::min(usedThreads, hardwareThreads);
 			}
 
-			std::vector<char>::const_iterator itBytes = dataIn.begin() + headerSize + 4;
-
-			node = treeNode;
+			const size_t rangeSize = lockstepWidth * ((groupCount + usedThreads - 1) / usedThreads);
+			const size_t rangeCount = (segments.segmentCount + rangeSize - 1) / rangeSize;
+			std::vector<uint8_t> rangesValid(rangeCount - 1, true);
+			std::vector<std::jthread> threads;
+			size_t first = 0;
 
-			while (true)
+			threads.reserve(rangeCount - 1);
+			for (size_t range = 0; range + 1 < rangeCount; ++range, first += rangeSize)
 			{
-				if (node->children.second == nullptr || node->children.first == nullptr)
+				try
 				{
-					dataOut.push_back(node->byte);
-					node = treeNode;
-					continue;
+					threads.emplace_back([&, range, first, itSegments]()
+					{
+						rangesValid[range] = decodeSegments(decodeTable, segments, layout.jumpTable, layout.payloadEnd, first, first + rangeSize, itSegments, out);
+					});
 				}
-				else
+				catch (const std::system_error &)
 				{
-					node = ((*itBytes & (1 << itBits)) >> itBits) ? node->children.second : node->children.first;
+					// The calling thread decodes this and all following ranges
+					break;
 				}
-
-				if (--itBits < 0)
+				for (size_t segment = first; segment < first + rangeSize; ++segment)
 				{
-					itBits = 7;
-					if (++itBytes == dataIn.end())
-					{
-						break;
-					}
+					itSegments += segmentEncodedSize(segments, layout.jumpTable, layout.payloadEnd, segment, itSegments);
 				}
 			}
+			const bool valid = decodeSegments(decodeTable, segments, layout.jumpTable, layout.payloadEnd, first, segments.segmentCount, itSegments, out);
+
+			// Joins all threads before their results are read
+			threads.clear();
+
+			return valid && std::find(rangesValid.begin(), rangesValid.end(), 0) == rangesValid.end();
+		}
+
+		/**
+		* \brief		Decode validated huffman encoded data
+		* \param[in]	block		Block header
+		* \param[in]	layout		Layout of a huffman coded block
+		* \param[out]	out			Buffer large enough for the decoded data
+		* \param[in]	threadCount	Number of threads decoding segments in parallel
+		* \return		Whether the data decoded without overruns
+		*/
+		bool decodeBlock(const block_t &block, const huffmanLayout_t &layout, char *out, const unsigned threadCount)
+		{
+			const size_t originalDataSize = static_cast<size_t>(block.dataSize);
+
+			switch (block.mode)
+			{
+			case blockMode_t::single:
+				std::memset(out, block.payload[0], originalDataSize);
+				break;
+			case blockMode_t::stored:
+				std::memcpy(out, block.payload, originalDataSize);
+				break;
+			case blockMode_t::huffman:
+				return decodeHuffmanBlock(layout, out, threadCount);
+			case blockMode_t::empty:
+				break;
+			}
+
+			return true;
+		}
+
+		/**
+		* \brief		Huffman decode entire dataset
+		* \details		The data is validated before the output is allocated.
+		* \param[in]	dataIn		Data to be decoded
+		* \param[in]	threadCount	Number of threads decoding segments in parallel
+		* \return		Huffman decoded data
+		*/
+		std::vector<char> decode(const std::vector<char> &dataIn, const unsigned threadCount)
+		{
+			block_t block;
+			huffmanLayout_t layout;
+
+			const result_t size = validate(std::as_bytes(std::span(dataIn)), block, layout);
+			if (size.error != errorCode_t::none)
+			{
+				throw std::invalid_argument("compression::huffman::decode: invalid input");
+			}
 
-			treeNode->freeRecursively();
-			treeNode = nullptr;
+			std::vector<char> dataOut(size.size);
 
-			while (dataOut.size() > originalDataSize)
+			if (!decodeBlock(block, layout, dataOut.data(), threadCount))
 			{
-				dataOut.erase(dataOut.end() - 1);
+				throw std::invalid_argument("compression::huffman::decode: invalid input");
 			}
 
 			return dataOut;
 		}
+
+		/**
+		* \brief		Huffman decode entire dataset into a caller provided buffer
+		* \param[in]	dataIn		Data to be decoded
+		* \param[out]	dataOut		Buffer receiving the huffman decoded data
+		* \param[in]	threadCount	Number of threads decoding segments in parallel
+		* \return		Size of the huffman decoded data
+		*/
+		result_t decode(std::span<const std::byte> dataIn, std::span<std::byte> dataOut, const unsigned threadCount)
+		{
+			block_t block;
+			huffmanLayout_t layout;
+
+			const result_t size = validate(dataIn, block, layout);
+			if (size.error != errorCode_t::none)
+			{
+				return size;
+			}
+			if (size.size > dataOut.size())
+			{
+				return { 0, errorCode_t::outputTooSmall };
+			}
+			if (!decodeBlock(block, layout, reinterpret_cast<char *>(dataOut.data()), threadCount))
+			{
+				return { 0, errorCode_t::invalidInput };
+			}
+
+			return size;
+		}
 	} // namespace huffman
 } // namespace compression
\ No newline at end of file
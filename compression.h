@@ -1,6 +1,9 @@
 /**
 * \file		compression.h
 * \brief	Interface providing various data compression functions
+* \details	All functions are reentrant and keep no shared mutable state, so any
+*			number of threads may encode and decode concurrently as long as each
+*			call works on its own output.
 * \author	Lukas Innerhofer
 * \version	1.0
 */
@@ -8,10 +11,52 @@
 #ifndef COMPRESSION_H
 #define COMPRESSION_H
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
 #include <vector>
 
 namespace compression
 {
+	/**
+	* \brief	Reasons encoding or decoding into a caller provided buffer can fail
+	*/
+	enum class errorCode_t
+	{
+		none,
+		outputTooSmall,
+		invalidInput
+	};
+
+	/**
+	* \brief	Outcome of encoding or decoding into a caller provided buffer
+	*/
+	struct result_t
+	{
+		/**
+		* \brief	Number of bytes written to the output, 0 on error
+		*/
+		size_t size = 0;
+		errorCode_t error = errorCode_t::none;
+	};
+
+	/**
+	* \brief	Occurences of every byte value in a dataset, indexed by unsigned byte value
+	*/
+	typedef std::array<uint64_t, 256> histogram_t;
+
+	/**
+	* \brief		Count occurences of every byte value in entire dataset
+	* \details		Shared by the entropy coders, usable by any codec needing symbol statistics.
+	*/
+	histogram_t histogram(const std::vector<char> &dataIn);
+
+	/**
+	* \brief		Count occurences of every byte value in entire dataset
+	*/
+	histogram_t histogram(std::span<const std::byte> dataIn);
+
 	/**
 	* \brief	Run-length encoding
 	* \details	Ideal for data containing many longer runs of the same byte.
@@ -20,28 +65,172 @@ namespace compression
 	{
 		/**
 		* \brief		RL encode entire dataset
-		* \remarks		Run-length encoding data that lacks many long byte runs 
-		*				may lead to a longer output than input.
+		* \remarks		Bytes outside of runs are copied as literals, so data lacking byte
+		*				runs grows by at most one byte per 128 bytes.
 		*/
 		std::vector<char> encode(const std::vector<char> &dataIn);
 
+		/**
+		* \brief		RL encode entire dataset into a caller provided buffer
+		* \return		Bytes written or errorCode_t::outputTooSmall
+		*/
+		result_t encode(std::span<const std::byte> dataIn, std::span<std::byte> dataOut);
+
+		/**
+		* \brief		Upper bound of the RL encoded size of \p dataSize bytes
+		*/
+		size_t maxEncodedSize(size_t dataSize);
+
+		/**
+		* \brief		Size of RL encoded data once decoded
+		* \details		Walks the encoded data without decoding it.
+		* \return		Decoded size or errorCode_t::invalidInput
+		*/
+		result_t decodedSize(std::span<const std::byte> dataIn);
+
 		/**
 		* \brief		RL decode entire dataset
+		* \throws		std::invalid_argument if \p dataIn is not RL encoded data or decodes
+		*				to more bytes than a vector can hold
+		* \throws		std::bad_alloc if the decoded data cannot be allocated
 		*/
 		std::vector<char> decode(const std::vector<char> &dataIn);
+
+		/**
+		* \brief		RL decode entire dataset into a caller provided buffer
+		* \return		Bytes written, errorCode_t::outputTooSmall or errorCode_t::invalidInput
+		*/
+		result_t decode(std::span<const std::byte> dataIn, std::span<std::byte> dataOut);
+
+		/**
+		* \brief		RL encode entire dataset of \p T elements
+		* \details		Runs are made of whole elements and counted in elements, which saves
+		*				control bytes over byte runs of multibyte values. Elements are
+		*				stored in host byte order. Available for uint8_t, uint16_t, uint32_t
+		*				and uint64_t, the uint8_t format matches encoding bytes.
+		*/
+		template <typename T>
+		std::vector<char> encode(const std::vector<T> &dataIn);
+
+		/**
+		* \brief		RL encode entire dataset of \p T elements into a caller provided buffer
+		* \return		Bytes written or errorCode_t::outputTooSmall
+		*/
+		template <typename T>
+		result_t encode(std::span<const T> dataIn, std::span<std::byte> dataOut);
+
+		/**
+		* \brief		Upper bound of the RL encoded size of \p elementCount elements of \p T
+		*/
+		template <typename T>
+		size_t maxEncodedSize(size_t elementCount);
+
+		/**
+		* \brief		Number of \p T elements of RL encoded data once decoded
+		* \return		Decoded element count or errorCode_t::invalidInput
+		*/
+		template <typename T>
+		result_t decodedSize(std::span<const std::byte> dataIn);
+
+		/**
+		* \brief		RL decode entire dataset of \p T elements
+		* \throws		std::invalid_argument if \p dataIn is not RL encoded data or decodes
+		*				to more elements than a vector can hold
+		* \throws		std::bad_alloc if the decoded data cannot be allocated
+		*/
+		template <typename T>
+		std::vector<T> decode(const std::vector<char> &dataIn);
+
+		/**
+		* \brief		RL decode entire dataset of \p T elements into a caller provided buffer
+		* \return		Elements written, errorCode_t::outputTooSmall or errorCode_t::invalidInput
+		*/
+		template <typename T>
+		result_t decode(std::span<const std::byte> dataIn, std::span<T> dataOut);
 	}
 
 	namespace huffman
 	{
+		/**
+		* \brief	Huffman encoder settings
+		*/
+		struct options_t
+		{
+			/**
+			* \brief	Upper bound of code lengths in bits, between 8 and 15
+			* \details	Lower bounds cost some compression on skewed data but keep
+			*			decoder lookup tables small.
+			*/
+			uint8_t maxCodeLength = 15;
+
+			/**
+			* \brief	Number of independent bitstreams the data is split into, at least 1
+			* \details	The streams share one code table and are decoded in lockstep, four
+			*			at a time, overlapping their otherwise serial dependency chains.
+			*			Data too small to fill every stream with 1 KiB uses fewer streams.
+			*/
+			uint8_t streamCount = 4;
+
+			/**
+			* \brief	Number of bytes per independently decodable block, 0 for none
+			* \details	If set, the data is split into blocks of this size instead of
+			*			\p streamCount streams. Every block is a separate bitstream listed
+			*			in the block index, allowing large data to be decoded in parallel.
+			*/
+			uint32_t blockSize = 0;
+		};
+
 		/**
 		* \brief		Huffman encode entire dataset
+		* \details		Empty data and data of a single byte value take a few bytes, data
+		*				huffman coding would not shrink is stored raw.
+		* \throws		std::invalid_argument if \p options are out of range
 		*/
-		std::vector<char> encode(const std::vector<char> &dataIn);
+		std::vector<char> encode(const std::vector<char> &dataIn, const options_t &options = options_t());
+
+		/**
+		* \brief		Huffman encode entire dataset into a caller provided buffer
+		* \details		Does not allocate.
+		* \return		Bytes written or errorCode_t::outputTooSmall
+		* \throws		std::invalid_argument if \p options are out of range
+		*/
+		result_t encode(std::span<const std::byte> dataIn, std::span<std::byte> dataOut, const options_t &options = options_t());
+
+		/**
+		* \brief		Upper bound of the huffman encoded size of \p dataSize bytes
+		* \details		Buffers of this size never fail with errorCode_t::outputTooSmall.
+		*				Data huffman coding would not shrink is stored raw, so this exceeds
+		*				\p dataSize by at most 12 bytes, 5 below 2 MiB.
+		*/
+		size_t maxEncodedSize(size_t dataSize, const options_t &options = options_t());
+
+		/**
+		* \brief		Size of huffman encoded data once decoded, read from its header
+		* \details		Only the first bytes of the encoded data are needed, at most 12. The
+		*				size is not checked against the rest of the data, so untrusted data
+		*				should be decoded by the allocating decode, which validates it first.
+		* \return		Decoded size or errorCode_t::invalidInput
+		*/
+		result_t decodedSize(std::span<const std::byte> dataIn);
 
 		/**
 		* \brief		Huffman decode entire dataset
+		* \details		The data is validated before the output is allocated, its claimed
+		*				size must be backed by the encoded data.
+		*				Data encoded into several streams or blocks can be decoded by up to
+		*				\p threadCount threads in parallel, at most one per hardware thread.
+		* \throws		std::invalid_argument if \p dataIn is not huffman encoded data
 		*/
-		std::vector<char> decode(const std::vector<char> &dataIn);
+		std::vector<char> decode(const std::vector<char> &dataIn, unsigned threadCount = 1);
+
+		/**
+		* \brief		Huffman decode entire dataset into a caller provided buffer
+		* \details		Data encoded into several streams or blocks can be decoded by up to
+		*				\p threadCount threads in parallel, at most one per hardware thread.
+		*				Does not allocate unless more than one thread is used.
+		* \return		Bytes written, errorCode_t::outputTooSmall or errorCode_t::invalidInput
+		*/
+		result_t decode(std::span<const std::byte> dataIn, std::span<std::byte> dataOut, unsigned threadCount = 1);
 	}
 }
 
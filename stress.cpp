@@ -0,0 +1,154 @@
+/**
+* \file		stress.cpp
+* \brief	Concurrent round trip test of all codecs
+* \details	Several threads encode and decode their own data at the same time, the
+*			huffman decoder additionally fanning out to threads of its own. Meant to
+*			be run under ThreadSanitizer and AddressSanitizer:
+*
+*			g++ -std=c++20 -O1 -g -fsanitize=thread stress.cpp compression.cpp -o stress -pthread
+*			g++ -std=c++20 -O1 -g -fsanitize=address,undefined stress.cpp compression.cpp -o stress -pthread
+*
+*			Usage: stress [threads] [iterations], by default 8 threads of 20 iterations.
+*			Exits with 0 if every round trip reproduced its data and every RL encode
+*			fit a buffer of exactly its size.
+* \author	Lukas Innerhofer
+* \version	1.0
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "compression.h"
+
+/**
+* \brief		Generate data mixing byte runs, skewed bytes and random bytes
+* \param[in]	random	Generator of this thread
+* \param[in]	size	Size of the data
+* \return		Generated data
+*/
+std::vector<char> generate(std::mt19937 &random, const size_t size)
+{
+	std::vector<char> data(size);
+
+	for (size_t byte = 0; byte < size;)
+	{
+		const size_t length = std::min<size_t>(size - byte, 1 + random() % 4096);
+
+		switch (random() % 3)
+		{
+		case 0:
+			std::memset(data.data() + byte, static_cast<char>(random()), length);
+			break;
+		case 1:
+			for (size_t end = byte + length; byte < end; ++byte)
+			{
+				data[byte] = "aaaabbbcdefgh"[random() % 13];
+			}
+			continue;
+		default:
+			for (size_t end = byte + length; byte < end; ++byte)
+			{
+				data[byte] = static_cast<char>(random());
+			}
+			continue;
+		}
+		byte += length;
+	}
+
+	return data;
+}
+
+/**
+* \brief		RL encode \p data as \p T elements into buffers of exactly and one byte less than the encoded size
+* \param[in]	data	Data to be encoded, trailing bytes short of an element are left out
+* \return		Number of encodes not matching the allocating encode
+*/
+template <typename T>
+unsigned exactFit(const std::vector<char> &data)
+{
+	std::vector<T> elements(data.size() / sizeof(T));
+	std::memcpy(elements.data(), data.data(), elements.size() * sizeof(T));
+
+	const std::vector<char> encoded = compression::rle::encode(elements);
+	std::vector<std::byte> exact(encoded.size());
+	std::vector<std::byte> tooSmall(encoded.size() - (encoded.empty() ? 0 : 1));
+	const compression::result_t result = compression::rle::encode(std::span<const T>(elements), std::span(exact));
+	unsigned failures = 0;
+
+	failures += result.error != compression::errorCode_t::none || result.size != encoded.size() || !std::equal(encoded.begin(), encoded.end(), reinterpret_cast<const char *>(exact.data()));
+	failures += !encoded.empty() && compression::rle::encode(std::span<const T>(elements), std::span(tooSmall)).error != compression::errorCode_t::outputTooSmall;
+
+	return failures;
+}
+
+/**
+* \brief		Round trip \p data through every codec
+* \param[in]	data		Data to be encoded
+* \param[in]	threadCount	Number of threads the huffman decoder may use
+* \return		Number of round trips that did not reproduce \p data
+*/
+unsigned roundTrip(const std::vector<char> &data, const unsigned threadCount)
+{
+	unsigned failures = 0;
+
+	failures += compression::rle::decode(compression::rle::encode(data)) != data;
+
+	std::vector<uint32_t> elements(data.size() / sizeof(uint32_t));
+	std::memcpy(elements.data(), data.data(), elements.size() * sizeof(uint32_t));
+	failures += compression::rle::decode<uint32_t>(compression::rle::encode(elements)) != elements;
+	failures += exactFit<uint8_t>(data) + exactFit<uint16_t>(data) + exactFit<uint32_t>(data) + exactFit<uint64_t>(data);
+
+	compression::huffman::options_t streams;
+	compression::huffman::options_t blocks;
+	blocks.blockSize = 4096;
+
+	for (const compression::huffman::options_t &options : { streams, blocks })
+	{
+		const std::vector<char> encoded = compression::huffman::encode(data, options);
+		std::vector<std::byte> decoded(data.size());
+		const compression::result_t result = compression::huffman::decode(std::as_bytes(std::span(encoded)), std::span(decoded), threadCount);
+
+		failures += compression::huffman::decode(encoded, threadCount) != data;
+		failures += result.error != compression::errorCode_t::none || result.size != data.size() || std::memcmp(decoded.data(), data.data(), data.size()) != 0;
+	}
+
+	return failures;
+}
+
+int main(int argc, char *argv[])
+{
+	const unsigned threadCount = argc > 1 ? std::stoul(argv[1]) : 8;
+	const unsigned iterationCount = argc > 2 ? std::stoul(argv[2]) : 20;
+	std::atomic<unsigned> failures = 0;
+	std::vector<std::thread> threads;
+
+	for (unsigned thread = 0; thread < threadCount; ++thread)
+	{
+		threads.emplace_back([&, thread]()
+		{
+			std::mt19937 random(thread);
+
+			for (unsigned iteration = 0; iteration < iterationCount; ++iteration)
+			{
+				// Mostly small data, now and then enough for the huffman decoder to start threads
+				const size_t size = iteration % 5 == 0 ? (1 << 20) + random() % (1 << 20) : random() % 65536;
+
+				failures += roundTrip(generate(random, size), 1 + iteration % 4);
+			}
+		});
+	}
+	for (std::thread &thread : threads)
+	{
+		thread.join();
+	}
+
+	std::cout << threadCount << " threads, " << iterationCount << " iterations, " << failures << " failures" << std::endl;
+
+	return failures == 0 ? 0 : 1;
+}